@@ -1,11 +1,18 @@
 #include "BetterTerrainPP.hpp"
+#include "MappedFile.hpp"
+#include "Trace.hpp"
 #include <godot_cpp/core/class_db.hpp>
 #include <godot_cpp/variant/utility_functions.hpp>
 #include <godot_cpp/templates/hashfuncs.hpp>
+#include <godot_cpp/variant/callable_method_pointer.hpp>
 
 #include <godot_cpp/classes/tile_set_atlas_source.hpp>
+#include <godot_cpp/classes/file_access.hpp>
+#include <godot_cpp/classes/project_settings.hpp>
 #include <set>
 #include <algorithm>
+#include <climits>
+#include <iterator>
 
 namespace
 {
@@ -99,40 +106,29 @@ std::map<int, std::vector<int>> peering_bits_after_symmetry(const std::map<int,
   return result;
 }
 
-std::vector<godot::Vector2i> neighboring_coords(godot::TileMapLayer* tilemap, godot::Vector2i coord, const std::vector<int>& peering)
+// The neighbors that share the given corner with a cell.
+std::vector<int> associated_vertex_neighbors(const godot::Ref<godot::TileSet>& tileset, godot::TileSet::CellNeighbor corner)
 {
-  std::vector<godot::Vector2i> result;
-  result.reserve(peering.size());
-  for (int p : peering)
-  {
-    result.push_back(tilemap->get_neighbor_cell(coord, static_cast<godot::TileSet::CellNeighbor>(p)));
-  }
-  return result;
-}
-
-std::vector<godot::Vector2i> associated_vertex_cells(godot::TileMapLayer* tilemap, godot::Vector2i coord, godot::TileSet::CellNeighbor corner)
-{
-  godot::Ref<godot::TileSet> tileset = tilemap->get_tile_set();
   if (tileset->get_tile_shape() == godot::TileSet::TILE_SHAPE_SQUARE ||
       tileset->get_tile_shape() == godot::TileSet::TILE_SHAPE_ISOMETRIC)
     switch (corner)
     {
     case godot::TileSet::CELL_NEIGHBOR_BOTTOM_RIGHT_CORNER:
-      return neighboring_coords(tilemap, coord, {0, 3, 4});
+      return {0, 3, 4};
     case godot::TileSet::CELL_NEIGHBOR_BOTTOM_LEFT_CORNER:
-      return neighboring_coords(tilemap, coord, {4, 7, 8});
+      return {4, 7, 8};
     case godot::TileSet::CELL_NEIGHBOR_TOP_LEFT_CORNER:
-      return neighboring_coords(tilemap, coord, {8, 11, 12});
+      return {8, 11, 12};
     case godot::TileSet::CELL_NEIGHBOR_TOP_RIGHT_CORNER:
-      return neighboring_coords(tilemap, coord, {12, 15, 0});
+      return {12, 15, 0};
     case godot::TileSet::CELL_NEIGHBOR_RIGHT_CORNER:
-      return neighboring_coords(tilemap, coord, {14, 1, 2});
+      return {14, 1, 2};
     case godot::TileSet::CELL_NEIGHBOR_BOTTOM_CORNER:
-      return neighboring_coords(tilemap, coord, {2, 5, 6});
+      return {2, 5, 6};
     case godot::TileSet::CELL_NEIGHBOR_LEFT_CORNER:
-      return neighboring_coords(tilemap, coord, {6, 9, 10});
+      return {6, 9, 10};
     case godot::TileSet::CELL_NEIGHBOR_TOP_CORNER:
-      return neighboring_coords(tilemap, coord, {10, 13, 14});
+      return {10, 13, 14};
     default:
       break;
     }
@@ -141,17 +137,17 @@ std::vector<godot::Vector2i> associated_vertex_cells(godot::TileMapLayer* tilema
     switch (corner)
     {
     case godot::TileSet::CELL_NEIGHBOR_BOTTOM_RIGHT_CORNER:
-      return neighboring_coords(tilemap, coord, {0, 2});
+      return {0, 2};
     case godot::TileSet::CELL_NEIGHBOR_BOTTOM_CORNER:
-      return neighboring_coords(tilemap, coord, {2, 6});
+      return {2, 6};
     case godot::TileSet::CELL_NEIGHBOR_BOTTOM_LEFT_CORNER:
-      return neighboring_coords(tilemap, coord, {6, 8});
+      return {6, 8};
     case godot::TileSet::CELL_NEIGHBOR_TOP_LEFT_CORNER:
-      return neighboring_coords(tilemap, coord, {8, 10});
+      return {8, 10};
     case godot::TileSet::CELL_NEIGHBOR_TOP_CORNER:
-      return neighboring_coords(tilemap, coord, {10, 14});
+      return {10, 14};
     case godot::TileSet::CELL_NEIGHBOR_TOP_RIGHT_CORNER:
-      return neighboring_coords(tilemap, coord, {14, 0});
+      return {14, 0};
     default:
       break;
     }
@@ -159,17 +155,17 @@ std::vector<godot::Vector2i> associated_vertex_cells(godot::TileMapLayer* tilema
   switch(corner)
   {
   case godot::TileSet::CELL_NEIGHBOR_RIGHT_CORNER:
-    return neighboring_coords(tilemap, coord, {14, 2});
+    return {14, 2};
   case godot::TileSet::CELL_NEIGHBOR_BOTTOM_RIGHT_CORNER:
-    return neighboring_coords(tilemap, coord, {2, 4});
+    return {2, 4};
   case godot::TileSet::CELL_NEIGHBOR_BOTTOM_LEFT_CORNER:
-    return neighboring_coords(tilemap, coord, {4, 6});
+    return {4, 6};
   case godot::TileSet::CELL_NEIGHBOR_LEFT_CORNER:
-    return neighboring_coords(tilemap, coord, {6, 10});
+    return {6, 10};
   case godot::TileSet::CELL_NEIGHBOR_TOP_LEFT_CORNER:
-    return neighboring_coords(tilemap, coord, {10, 12});
+    return {10, 12};
   case godot::TileSet::CELL_NEIGHBOR_TOP_RIGHT_CORNER:
-    return neighboring_coords(tilemap, coord, {12, 14});
+    return {12, 14};
   default:
     break;
   }
@@ -184,6 +180,61 @@ V map_safe_get(const std::map<K, V>& m, const K& key, const V& def)
   return it == m.end() ? def : it->second;
 }
 
+// Rows [first_row, last_row) of a row-major terrain type raster, one signed
+// byte per cell. Cells off the map are empty, as get_cell reports for an
+// unpainted TileMapLayer; rows of the map outside the window behave like keys
+// missing from a types map.
+struct RasterWindow
+{
+  // Offsets to each neighbor, indexed by the parity of a cell's y and x.
+  struct NeighborOffsets
+  {
+    godot::Vector2i cells[2][2][16];
+  };
+
+  const NeighborOffsets* offsets;
+  const int8_t* rows;
+  int width;
+  int height;
+  int first_row;
+  int last_row;
+};
+
+int map_safe_get(const RasterWindow& window, const godot::Vector2i& key, const int& def)
+{
+  if (key.x < 0 || key.x >= window.width || key.y < 0 || key.y >= window.height)
+    return TerrainType::EMPTY;
+  if (key.y < window.first_row || key.y >= window.last_row)
+    return def;
+  return window.rows[static_cast<int64_t>(key.y - window.first_row) * window.width + key.x];
+}
+
+godot::Vector2i neighbor_cell(godot::TileMapLayer* tilemap, const std::map<godot::Vector2i, int>&, godot::Vector2i coord, int neighbor)
+{
+  return tilemap->get_neighbor_cell(coord, static_cast<godot::TileSet::CellNeighbor>(neighbor));
+}
+
+godot::Vector2i neighbor_cell(godot::TileMapLayer*, const RasterWindow& window, godot::Vector2i coord, int neighbor)
+{
+  return coord + window.offsets->cells[coord.y & 1][coord.x & 1][neighbor];
+}
+
+// Baked output: a header of magic, version, width and height, followed by one
+// record per cell in row-major order: source (s32), atlas x (s16), atlas y (s16),
+// alternative (s32). All values are little endian. Cells without a placement
+// are written with source -1.
+const char baked_magic[] = "BTPB";
+const int baked_version = 1;
+const int baked_header_size = 16;
+const int baked_record_size = 12;
+
+uint8_t* write_le(uint8_t* out, int64_t value, int bytes)
+{
+  for (int b = 0; b < bytes; ++b)
+    *out++ = static_cast<uint8_t>((value >> (8 * b)) & 0xff);
+  return out;
+}
+
 }
 
 BetterTerrainPP::Placement BetterTerrainPP::empty_placement{-1, godot::Vector2i(0, 0), -1, {}, 1.0};
@@ -192,11 +243,13 @@ void BetterTerrainPP::_bind_methods()
 {
   godot::ClassDB::bind_method(godot::D_METHOD("init", "map", "fixed_random_seed"), &BetterTerrainPP::init, DEFVAL(false));
   godot::ClassDB::bind_method(godot::D_METHOD("get_cell", "coord"), &BetterTerrainPP::get_cell);
-  godot::ClassDB::bind_method(godot::D_METHOD("set_cells", "coords", "type"), &BetterTerrainPP::set_cells);
-  godot::ClassDB::bind_method(godot::D_METHOD("set_cell", "coord", "type"), &BetterTerrainPP::set_cell);
-  godot::ClassDB::bind_method(godot::D_METHOD("update_terrain_cells", "cells", "and_surrounding_cells"), &BetterTerrainPP::update_terrain_cells, DEFVAL(true));
-  godot::ClassDB::bind_method(godot::D_METHOD("update_terrain_cell", "cell", "and_surrounding_cells"), &BetterTerrainPP::update_terrain_cell, DEFVAL(true));
-  godot::ClassDB::bind_method(godot::D_METHOD("update_terrain_area", "area", "and_surrounding_cells"), &BetterTerrainPP::update_terrain_area, DEFVAL(true));
+  godot::ClassDB::bind_method(godot::D_METHOD("set_cells", "coords", "type", "delta"), &BetterTerrainPP::set_cells, DEFVAL(godot::Variant()));
+  godot::ClassDB::bind_method(godot::D_METHOD("set_cell", "coord", "type", "delta"), &BetterTerrainPP::set_cell, DEFVAL(godot::Variant()));
+  godot::ClassDB::bind_method(godot::D_METHOD("update_terrain_cells", "cells", "and_surrounding_cells", "delta"), &BetterTerrainPP::update_terrain_cells, DEFVAL(true), DEFVAL(godot::Variant()));
+  godot::ClassDB::bind_method(godot::D_METHOD("update_terrain_cell", "cell", "and_surrounding_cells", "delta"), &BetterTerrainPP::update_terrain_cell, DEFVAL(true), DEFVAL(godot::Variant()));
+  godot::ClassDB::bind_method(godot::D_METHOD("update_terrain_area", "area", "and_surrounding_cells", "delta"), &BetterTerrainPP::update_terrain_area, DEFVAL(true), DEFVAL(godot::Variant()));
+  godot::ClassDB::bind_method(godot::D_METHOD("generate_from_raster", "raster_path", "width", "output_path", "stripe_rows"), &BetterTerrainPP::generate_from_raster, DEFVAL(256));
+  godot::ClassDB::bind_method(godot::D_METHOD("dump_trace", "path"), &BetterTerrainPP::dump_trace);
 }
 
 BetterTerrainPP::BetterTerrainPP()
@@ -212,6 +265,10 @@ bool BetterTerrainPP::init(godot::TileMapLayer* tilemap, bool fixed_random_seed)
   if (!tileset.is_valid())
     return false;
 
+  const godot::Callable on_changed = callable_mp(this, &BetterTerrainPP::on_tileset_changed);
+  if (m_tileset.is_valid() && m_tileset->is_connected("changed", on_changed))
+    m_tileset->disconnect("changed", on_changed);
+
   m_tilemap = tilemap;
   m_tileset = tileset;
 
@@ -219,11 +276,78 @@ bool BetterTerrainPP::init(godot::TileMapLayer* tilemap, bool fixed_random_seed)
   if (godot::String(meta["version"]) != meta_version)
     return false;
 
-  m_cache.clear();
+  m_sources.clear();
+  m_rebuild_pending = false;
+  rebuild(meta);
+  tileset->connect("changed", on_changed);
+
+  m_fixed_random_seed = fixed_random_seed;
+  m_rng->randomize();
+  return true;
+}
+
+void BetterTerrainPP::on_tileset_changed()
+{
+  // The tileset emits changed many times during a single edit, so coalesce
+  // them into one rebuild at idle time, or before the next use if sooner.
+  if (m_rebuild_pending)
+    return;
+
+  m_rebuild_pending = true;
+  callable_mp(this, &BetterTerrainPP::rebuild_if_pending).call_deferred();
+}
+
+void BetterTerrainPP::rebuild_if_pending()
+{
+  if (!m_rebuild_pending)
+    return;
+  m_rebuild_pending = false;
+
+  godot::Dictionary meta = m_tileset->get_meta(meta_name, godot::Dictionary());
+  if (godot::String(meta.get("version", "")) != meta_version)
+  {
+    m_cache.clear();
+    m_sources.clear();
+    m_terrain_types.clear();
+    ERR_FAIL_MSG("TileSet terrain metadata is missing or has the wrong version; terrain placements cleared.");
+  }
+
+  rebuild(meta);
+}
+
+void BetterTerrainPP::rebuild(const godot::Dictionary& meta)
+{
+  BT_TRACE_ZONE("rebuild");
+  godot::Array terrains = meta["terrains"];
+
+  // Corners that are not part of this tile shape get no vertex neighbors.
+  m_peering_cells = &get_terrain_peering_cells();
+  for (int k = 0; k < 16; ++k)
+  {
+    std::vector<int> cells = associated_vertex_neighbors(m_tileset, static_cast<godot::TileSet::CellNeighbor>(k));
+    const bool valid = std::all_of(cells.begin(), cells.end(), [this](int n) {
+      return std::find(m_peering_cells->begin(), m_peering_cells->end(), n) != m_peering_cells->end();
+    });
+    m_vertex_neighbors[k] = valid ? std::move(cells) : std::vector<int>{};
+  }
+
+  // Peering targets depend on the number of terrains and their categories,
+  // so a change to either invalidates all compiled sources. Names, colors
+  // and the like do not.
+  uint32_t terrains_hash = godot::hash_murmur3_one_32(terrains.size());
+  for (int i = 0; i < static_cast<int>(terrains.size()); ++i)
+  {
+    godot::Array terrain = terrains[i];
+    terrains_hash = godot::hash_murmur3_one_32(godot::Variant(terrain[3]).hash(), terrains_hash);
+  }
+  terrains_hash = godot::hash_fmix32(terrains_hash);
+  if (terrains_hash != m_terrains_hash)
+    m_sources.clear();
+  m_terrains_hash = terrains_hash;
+
   m_terrain_types.clear();
 
   std::map<int, std::vector<int>> types;
-  godot::Array terrains = meta["terrains"];
   for (int i = 0; i < static_cast<int>(terrains.size()); ++i)
   {
     godot::Array terrain = terrains[i];
@@ -233,83 +357,132 @@ bool BetterTerrainPP::init(godot::TileMapLayer* tilemap, bool fixed_random_seed)
     for (int c = 0; c < static_cast<int>(categories.size()); ++c)
       bits.push_back(categories[c]);
     types[i] = std::move(bits);
-    m_cache[i] = {};
   }
 
   types[-1] = {-1};
-  m_cache[-1] = {Placement{-1, godot::Vector2i(0, 0), -1, {}, 1.0}};
 
-  for (int s = 0; s < tileset->get_source_count(); ++s)
+  std::vector<int> source_order;
+  std::map<int, SourceCache> sources;
+  for (int s = 0; s < m_tileset->get_source_count(); ++s)
   {
-    auto source_id = tileset->get_source_id(s);
-    auto source = godot::Object::cast_to<godot::TileSetAtlasSource>(tileset->get_source(source_id).ptr());
+    auto source_id = m_tileset->get_source_id(s);
+    auto source = godot::Object::cast_to<godot::TileSetAtlasSource>(m_tileset->get_source(source_id).ptr());
     if (!source)
       continue;
 
-    for (int c = 0; c < source->get_tiles_count(); ++c)
+    source_order.push_back(source_id);
+    const uint32_t fingerprint = source_fingerprint(source);
+    auto it = m_sources.find(source_id);
+    if (it != m_sources.end() && it->second.fingerprint == fingerprint)
+      sources[source_id] = std::move(it->second);
+    else
+      sources[source_id] = compile_source(source_id, source, types, fingerprint);
+  }
+  m_sources = std::move(sources);
+
+  m_cache.clear();
+  for (int i = 0; i < static_cast<int>(terrains.size()); ++i)
+    m_cache[i] = {};
+  m_cache[-1] = {&empty_placement};
+
+  for (int source_id : source_order)
+    for (const auto& [type, placements] : m_sources[source_id].placements)
     {
-      godot::Vector2i coord = source->get_tile_id(c);
-      for (int a = 0; a < source->get_alternative_tiles_count(coord); ++a)
+      auto& cached = m_cache[type];
+      for (const Placement& p : placements)
+        cached.push_back(&p);
+    }
+}
+
+uint32_t BetterTerrainPP::source_fingerprint(godot::TileSetAtlasSource* source) const
+{
+  BT_TRACE_ZONE("source_fingerprint");
+  uint32_t hash = godot::hash_murmur3_one_32(source->get_tiles_count());
+  for (int c = 0; c < source->get_tiles_count(); ++c)
+  {
+    godot::Vector2i coord = source->get_tile_id(c);
+    hash = godot::hash_murmur3_one_32(coord.x, hash);
+    hash = godot::hash_murmur3_one_32(coord.y, hash);
+    for (int a = 0; a < source->get_alternative_tiles_count(coord); ++a)
+    {
+      int alternate = source->get_alternative_tile_id(coord, a);
+      godot::TileData* td = source->get_tile_data(coord, alternate);
+      hash = godot::hash_murmur3_one_32(alternate, hash);
+      hash = godot::hash_murmur3_one_double(td->get_probability(), hash);
+      if (td->has_meta(meta_name))
+        hash = godot::hash_murmur3_one_32(td->get_meta(meta_name).hash(), hash);
+    }
+  }
+  return godot::hash_fmix32(hash);
+}
+
+BetterTerrainPP::SourceCache BetterTerrainPP::compile_source(int source_id, godot::TileSetAtlasSource* source, const std::map<int, std::vector<int>>& types, uint32_t fingerprint) const
+{
+  BT_TRACE_ZONE("compile_source");
+  SourceCache result{fingerprint, {}};
+  const int terrain_count = static_cast<int>(m_terrain_types.size());
+
+  for (int c = 0; c < source->get_tiles_count(); ++c)
+  {
+    godot::Vector2i coord = source->get_tile_id(c);
+    for (int a = 0; a < source->get_alternative_tiles_count(coord); ++a)
+    {
+      int alternate = source->get_alternative_tile_id(coord, a);
+      godot::TileData* td = source->get_tile_data(coord, alternate);
+      if (!td->has_meta(meta_name))
+        continue;
+      godot::Dictionary td_meta = td->get_meta(meta_name);
+      int td_meta_type = td_meta["type"];
+      if (td_meta_type < TerrainType::EMPTY || td_meta_type > terrain_count)
+        continue;
+
+      std::map<int, std::vector<int>> peering;
+      godot::Array td_meta_keys = td_meta.keys();
+      for (int k = 0; k < static_cast<int>(td_meta_keys.size()); ++k)
       {
-        int alternate = source->get_alternative_tile_id(coord, a);
-        godot::TileData* td = source->get_tile_data(coord, alternate);
-        if (!td->has_meta(meta_name))
-          continue;
-        godot::Dictionary td_meta = td->get_meta(meta_name);
-        int td_meta_type = td_meta["type"];
-        if (td_meta_type < TerrainType::EMPTY || td_meta_type > static_cast<int>(terrains.size()))
+        auto key = td_meta_keys[k];
+        if (key.get_type() != godot::Variant::INT)
           continue;
 
-        std::map<int, std::vector<int>> peering;
-        godot::Array td_meta_keys = td_meta.keys();
-        for (int k = 0; k < static_cast<int>(td_meta_keys.size()); ++k)
+        std::vector<int> targets;
+        for (const auto& [type, bits] : types)
         {
-          auto key = td_meta_keys[k];
-          if (key.get_type() != godot::Variant::INT)
-            continue;
-
-          std::vector<int> targets;
-          for (const auto& [type, bits] : types)
-          {
-            if (has_intersection(bits, td_meta[key]))
-              targets.push_back(type);
-          }
-
-          peering[int(key)] = std::move(targets);
+          if (has_intersection(bits, td_meta[key]))
+            targets.push_back(type);
         }
 
-        if (td_meta_type == TerrainType::EMPTY && peering.empty())
-          continue;
+        peering[int(key)] = std::move(targets);
+      }
 
-        int symmetry = td_meta.get("symmetry", SymmetryType::NONE);
+      if (td_meta_type == TerrainType::EMPTY && peering.empty())
+        continue;
 
-        if (symmetry == SymmetryType::NONE)
-        {
-            m_cache[td_meta_type].push_back(Placement{source_id, coord, alternate, std::move(peering), td->get_probability()});
-            continue;
-        }
+      int symmetry = td_meta.get("symmetry", SymmetryType::NONE);
 
-        int symmetry_order = 0;
-        for (const auto flags : symmetry_mapping[symmetry])
-        {
-          std::map<int, std::vector<int>> symmetric_peering = peering_bits_after_symmetry(peering, flags);
-          if (symmetric_peering == peering)
-              ++symmetry_order;
-        }
+      if (symmetry == SymmetryType::NONE)
+      {
+          result.placements[td_meta_type].push_back(Placement{source_id, coord, alternate, std::move(peering), td->get_probability()});
+          continue;
+      }
 
-        const double adjusted_probability = td->get_probability() / symmetry_order;
-        for (const auto flags : symmetry_mapping[symmetry])
-        {
-          std::map<int, std::vector<int>> symmetric_peering = peering_bits_after_symmetry(peering, flags);
-          m_cache[td_meta_type].push_back(Placement{source_id, coord, alternate | flags, std::move(symmetric_peering), adjusted_probability});
-        }
+      int symmetry_order = 0;
+      for (const auto flags : symmetry_mapping[symmetry])
+      {
+        std::map<int, std::vector<int>> symmetric_peering = peering_bits_after_symmetry(peering, flags);
+        if (symmetric_peering == peering)
+            ++symmetry_order;
+      }
+
+      const double adjusted_probability = td->get_probability() / symmetry_order;
+      for (const auto flags : symmetry_mapping[symmetry])
+      {
+        std::map<int, std::vector<int>> symmetric_peering = peering_bits_after_symmetry(peering, flags);
+        result.placements[td_meta_type].push_back(Placement{source_id, coord, alternate | flags, std::move(symmetric_peering), adjusted_probability});
       }
     }
   }
 
-  m_fixed_random_seed = fixed_random_seed;
-  m_rng->randomize();
-  return true;
+  return result;
 }
 
 int BetterTerrainPP::get_cell(godot::Vector2i coord) const
@@ -329,14 +502,17 @@ int BetterTerrainPP::get_cell(godot::Vector2i coord) const
   return td_meta_type;
 }
 
-bool BetterTerrainPP::set_cell(godot::Vector2i coord, int type)
+bool BetterTerrainPP::set_cell(godot::Vector2i coord, int type, const godot::Ref<BetterTerrainPPDelta>& delta)
 {
+  rebuild_if_pending();
   if (!m_tilemap || m_tileset.is_null() || type < TerrainType::EMPTY)
     return false;
 
   if (type == TerrainType::EMPTY)
   {
-    m_tilemap->erase_cell(coord);
+    write_cell(coord, -1, godot::Vector2i(-1, -1), -1, delta.ptr());
+    if (delta.is_valid())
+      delta->encode_pending();
     return true;
   }
 
@@ -346,20 +522,25 @@ bool BetterTerrainPP::set_cell(godot::Vector2i coord, int type)
   if (m_cache[type].empty())
     return false;
 
-  const Placement& p = *(m_cache[type].begin());
-  m_tilemap->set_cell(coord, p.source_id, p.coord, p.alternative);
+  const Placement& p = *m_cache[type].front();
+  write_cell(coord, p.source_id, p.coord, p.alternative, delta.ptr());
+  if (delta.is_valid())
+    delta->encode_pending();
   return true;
 }
 
-bool BetterTerrainPP::set_cells(const godot::Array& coords, int type)
+bool BetterTerrainPP::set_cells(const godot::Array& coords, int type, const godot::Ref<BetterTerrainPPDelta>& delta)
 {
+  rebuild_if_pending();
   if (!m_tilemap || m_tileset.is_null() || type < TerrainType::EMPTY)
     return false;
 
   if (type == TerrainType::EMPTY)
   {
     for (int c = 0; c < static_cast<int>(coords.size()); ++c)
-      m_tilemap->erase_cell(coords[c]);
+      write_cell(coords[c], -1, godot::Vector2i(-1, -1), -1, delta.ptr());
+    if (delta.is_valid())
+      delta->encode_pending();
     return true;
   }
 
@@ -369,17 +550,23 @@ bool BetterTerrainPP::set_cells(const godot::Array& coords, int type)
   if (m_cache[type].empty())
     return false;
 
-  const Placement& p = *(m_cache[type].begin());
+  BT_TRACE_ZONE("set_cells");
+  const Placement& p = *m_cache[type].front();
   for (int c = 0; c < static_cast<int>(coords.size()); ++c)
-    m_tilemap->set_cell(coords[c], p.source_id, p.coord, p.alternative);
+    write_cell(coords[c], p.source_id, p.coord, p.alternative, delta.ptr());
+  if (delta.is_valid())
+    delta->encode_pending();
   return true;
 }
 
-void BetterTerrainPP::update_terrain_cells(const godot::Array& cells, bool and_surrounding_cells)
+void BetterTerrainPP::update_terrain_cells(const godot::Array& cells, bool and_surrounding_cells, const godot::Ref<BetterTerrainPPDelta>& delta)
 {
+  rebuild_if_pending();
   if (!m_tilemap || m_tileset.is_null())
     return;
 
+  BT_TRACE_ZONE("update_terrain_cells");
+
   std::vector<godot::Vector2i> coords;
   coords.reserve(cells.size());
   for (int c = 0; c < static_cast<int>(cells.size()); ++c)
@@ -390,25 +577,30 @@ void BetterTerrainPP::update_terrain_cells(const godot::Array& cells, bool and_s
   auto needed_cells = widen(coords);
 
   std::map<godot::Vector2i, int> types;
-  for (const auto& c : needed_cells)
-    types[c] = get_cell(c);
+  {
+    BT_TRACE_ZONE("read types");
+    for (const auto& c : needed_cells)
+      types[c] = get_cell(c);
+  }
 
-  for (const auto& c : coords)
-    update_tile_immediate(c, types);
+  update_tiles(coords, types, delta.ptr());
 }
 
-void BetterTerrainPP::update_terrain_cell(godot::Vector2i cell, bool and_surrounding_cells)
+void BetterTerrainPP::update_terrain_cell(godot::Vector2i cell, bool and_surrounding_cells, const godot::Ref<BetterTerrainPPDelta>& delta)
 {
   godot::Array cells;
   cells.push_back(cell);
-  update_terrain_cells(cells, and_surrounding_cells);
+  update_terrain_cells(cells, and_surrounding_cells, delta);
 }
 
-void BetterTerrainPP::update_terrain_area(godot::Rect2i area, bool and_surrounding_cells)
+void BetterTerrainPP::update_terrain_area(godot::Rect2i area, bool and_surrounding_cells, const godot::Ref<BetterTerrainPPDelta>& delta)
 {
+  rebuild_if_pending();
   if (!m_tilemap || m_tileset.is_null())
     return;
 
+  BT_TRACE_ZONE("update_terrain_area");
+
   area = area.abs();
 
   std::vector<godot::Vector2i> edges;
@@ -433,24 +625,122 @@ void BetterTerrainPP::update_terrain_area(godot::Rect2i area, bool and_surroundi
   }
 
   std::map<godot::Vector2i, int> types;
-  for (int y = area.position.y; y < area.position.y + area.size.y; ++y)
-    for (int x = area.position.x; x < area.position.x + area.size.x; ++x)
-    {
-      godot::Vector2i coord(x, y);
-      types[coord] = get_cell(coord);
-    }
-  for (const auto& c : needed_cells)
-    types[c] = get_cell(c);
+  {
+    BT_TRACE_ZONE("read types");
+    for (int y = area.position.y; y < area.position.y + area.size.y; ++y)
+      for (int x = area.position.x; x < area.position.x + area.size.x; ++x)
+      {
+        godot::Vector2i coord(x, y);
+        types[coord] = get_cell(coord);
+      }
+    for (const auto& c : needed_cells)
+      types[c] = get_cell(c);
+  }
 
+  std::vector<godot::Vector2i> coords;
+  coords.reserve(static_cast<size_t>(area.size.x) * area.size.y + additional_cells.size());
   for (int y = area.position.y; y < area.position.y + area.size.y; ++y)
     for (int x = area.position.x; x < area.position.x + area.size.x; ++x)
-      update_tile_immediate(godot::Vector2i(x, y), types);
-  for (const auto& c : additional_cells)
-    update_tile_immediate(c, types);
+      coords.push_back(godot::Vector2i(x, y));
+  coords.insert(coords.end(), additional_cells.begin(), additional_cells.end());
+
+  update_tiles(coords, types, delta.ptr());
+}
+
+bool BetterTerrainPP::generate_from_raster(const godot::String& raster_path, int width, const godot::String& output_path, int stripe_rows)
+{
+  rebuild_if_pending();
+  if (!m_tilemap || m_tileset.is_null() || !m_peering_cells || width <= 0 || stripe_rows <= 0)
+    return false;
+
+  MappedFile raster;
+  ERR_FAIL_COND_V_MSG(!raster.open(godot::ProjectSettings::get_singleton()->globalize_path(raster_path)), false, "Unable to open terrain raster: " + raster_path);
+  ERR_FAIL_COND_V_MSG(raster.size() % width != 0, false, "Terrain raster size is not a multiple of its width.");
+  ERR_FAIL_COND_V_MSG(raster.size() / width > INT_MAX, false, "Terrain raster is too tall.");
+  const int height = static_cast<int>(raster.size() / width);
+
+  godot::Ref<godot::FileAccess> out = godot::FileAccess::open(output_path, godot::FileAccess::WRITE);
+  ERR_FAIL_COND_V_MSG(out.is_null(), false, "Unable to open baked output: " + output_path);
+
+  godot::PackedByteArray header;
+  header.resize(baked_header_size);
+  uint8_t* h = header.ptrw();
+  for (int i = 0; i < 4; ++i)
+    *h++ = static_cast<uint8_t>(baked_magic[i]);
+  h = write_le(h, baked_version, 4);
+  h = write_le(h, width, 4);
+  write_le(h, height, 4);
+  out->store_buffer(header);
+
+  // Stacked isometric layouts find their top and bottom corner neighbors two
+  // rows away, so that is the most any match can look outside its stripe.
+  const int halo = 2;
+
+  stripe_rows = std::min(stripe_rows, height);
+
+  // Neighbor offsets only vary with the parity of a cell's coordinates, so
+  // ask the engine once per parity rather than once per cell.
+  RasterWindow::NeighborOffsets offsets;
+  for (int py = 0; py < 2; ++py)
+    for (int px = 0; px < 2; ++px)
+      for (int k : *m_peering_cells)
+      {
+        godot::Vector2i base(px, py);
+        offsets.cells[py][px][k] = m_tilemap->get_neighbor_cell(base, static_cast<godot::TileSet::CellNeighbor>(k)) - base;
+      }
+
+  godot::PackedByteArray records;
+  for (int64_t stripe = 0; stripe < height; stripe += stripe_rows)
+  {
+    BT_TRACE_ZONE("raster stripe");
+    const int y0 = static_cast<int>(stripe);
+    const int y1 = static_cast<int>(std::min<int64_t>(height, stripe + stripe_rows));
+
+    RasterWindow window;
+    window.offsets = &offsets;
+    window.width = width;
+    window.height = height;
+    window.first_row = std::max(0, y0 - halo);
+    window.last_row = static_cast<int>(std::min<int64_t>(height, static_cast<int64_t>(y1) + halo));
+    window.rows = reinterpret_cast<const int8_t*>(raster.map(static_cast<uint64_t>(window.first_row) * width, static_cast<uint64_t>(window.last_row - window.first_row) * width));
+    ERR_FAIL_NULL_V_MSG(window.rows, false, "Unable to map terrain raster rows.");
+
+    records.resize(static_cast<int64_t>(y1 - y0) * width * baked_record_size);
+    uint8_t* r = records.ptrw();
+    for (int y = y0; y < y1; ++y)
+      for (int x = 0; x < width; ++x)
+      {
+        const Placement* placement = select_placement(godot::Vector2i(x, y), window);
+        if (!placement)
+          placement = &empty_placement;
+        r = write_le(r, placement->source_id, 4);
+        r = write_le(r, placement->coord.x, 2);
+        r = write_le(r, placement->coord.y, 2);
+        r = write_le(r, placement->alternative, 4);
+      }
+
+    BT_TRACE_ZONE("write stripe");
+    out->store_buffer(records);
+  }
+
+  return out->get_error() == godot::OK;
+}
+
+bool BetterTerrainPP::dump_trace(const godot::String& path) const
+{
+#ifdef BETTER_TERRAIN_TRACE
+  godot::Ref<godot::FileAccess> out = godot::FileAccess::open(path, godot::FileAccess::WRITE);
+  ERR_FAIL_COND_V_MSG(out.is_null(), false, "Unable to open trace output: " + path);
+  out->store_string(trace::chrome_json());
+  return out->get_error() == godot::OK;
+#else
+  ERR_FAIL_V_MSG(false, "Tracing is not compiled in; build with trace=yes.");
+#endif
 }
 
 std::vector<godot::Vector2i> BetterTerrainPP::widen(const std::vector<godot::Vector2i>& coords) const
 {
+  BT_TRACE_ZONE("widen");
   std::set<godot::Vector2i> result;
   for (const godot::Vector2i& c : coords)
   {
@@ -467,6 +757,7 @@ std::vector<godot::Vector2i> BetterTerrainPP::widen(const std::vector<godot::Vec
 
 std::vector<godot::Vector2i> BetterTerrainPP::widen_with_exclusion(const std::vector<godot::Vector2i>& coords, const godot::Rect2i& exclusion) const
 {
+  BT_TRACE_ZONE("widen_with_exclusion");
   std::set<godot::Vector2i> result;
   for (const godot::Vector2i& c : coords)
   {
@@ -495,25 +786,59 @@ const std::vector<int>& BetterTerrainPP::get_terrain_peering_cells() const
   return terrain_peering_horiztonal_tiles;
 }
 
-void BetterTerrainPP::update_tile_immediate(godot::Vector2i coord, const std::map<godot::Vector2i, int>& types)
+void BetterTerrainPP::write_cell(godot::Vector2i coord, int source_id, godot::Vector2i atlas_coord, int alternative, BetterTerrainPPDelta* delta)
+{
+  if (delta)
+  {
+    BetterTerrainPPDelta::Cell before{m_tilemap->get_cell_source_id(coord), m_tilemap->get_cell_atlas_coords(coord), m_tilemap->get_cell_alternative_tile(coord)};
+    delta->record(coord, before, {source_id, atlas_coord, alternative});
+  }
+
+  if (source_id == -1)
+    m_tilemap->erase_cell(coord);
+  else
+    m_tilemap->set_cell(coord, source_id, atlas_coord, alternative);
+}
+
+void BetterTerrainPP::update_tiles(const std::vector<godot::Vector2i>& coords, const std::map<godot::Vector2i, int>& types, BetterTerrainPPDelta* delta)
+{
+  // Scoring only reads types, never the tilemap, so every placement can be
+  // chosen before any is written.
+  std::vector<const Placement*> placements;
+  placements.reserve(coords.size());
+  {
+    BT_TRACE_ZONE("score");
+    for (const auto& c : coords)
+      placements.push_back(select_placement(c, types));
+  }
+
+  BT_TRACE_ZONE("write");
+  for (size_t i = 0; i < coords.size(); ++i)
+    if (placements[i])
+      write_cell(coords[i], placements[i]->source_id, placements[i]->coord, placements[i]->alternative, delta);
+
+  if (delta)
+    delta->encode_pending();
+}
+
+template<typename Types>
+const BetterTerrainPP::Placement* BetterTerrainPP::select_placement(godot::Vector2i coord, const Types& types) const
 {
   int type = map_safe_get(types, coord, -1);
   if (type < TerrainType::EMPTY || type >= static_cast<int>(m_terrain_types.size()))
-    return;
+    return nullptr;
 
   // Don't access m_terrain_types if type is Empty (-1)
   const bool terrain_is_decoration = type == TerrainType::EMPTY;
-  const Placement* placement {nullptr};
   if (terrain_is_decoration || m_terrain_types[type] == TerrainType::MATCH_TILES)
-    placement = update_tile_tiles(coord, types, terrain_is_decoration);
-  else if (m_terrain_types[type] == TerrainType::MATCH_VERTICES)
-    placement = update_tile_vertices(coord, types);
-
-  if (placement)
-    m_tilemap->set_cell(coord, placement->source_id, placement->coord, placement->alternative);
+    return update_tile_tiles(coord, types, terrain_is_decoration);
+  if (m_terrain_types[type] == TerrainType::MATCH_VERTICES)
+    return update_tile_vertices(coord, types);
+  return nullptr;
 }
 
-const BetterTerrainPP::Placement* BetterTerrainPP::update_tile_tiles(godot::Vector2i coord, const std::map<godot::Vector2i, int>& types, bool apply_empty_probability) const
+template<typename Types>
+const BetterTerrainPP::Placement* BetterTerrainPP::update_tile_tiles(godot::Vector2i coord, const Types& types, bool apply_empty_probability) const
 {
   int type = map_safe_get(types, coord, -1);
   int best_score = -1000;
@@ -526,13 +851,18 @@ const BetterTerrainPP::Placement* BetterTerrainPP::update_tile_tiles(godot::Vect
   const int reward = 3;
   const int penalty = apply_empty_probability ? -2000 : -10;
 
-  for (const auto& p : it->second)
+  // Resolve each neighbor once per cell rather than once per candidate.
+  int neighbor_types[16];
+  std::fill(std::begin(neighbor_types), std::end(neighbor_types), static_cast<int>(TerrainType::NON_TERRAIN));
+  for (int k : *m_peering_cells)
+    neighbor_types[k] = map_safe_get(types, neighbor_cell(m_tilemap, types, coord, k), -2);
+
+  for (const Placement* p : it->second)
   {
     int score = 0;
-    for (const auto& [k, v] : p.peering)
+    for (const auto& [k, v] : p->peering)
     {
-      godot::Vector2i neighbor = m_tilemap->get_neighbor_cell(coord, static_cast<godot::TileSet::CellNeighbor>(k));
-      int target = map_safe_get(types, neighbor, -2);
+      int target = k >= 0 && k < 16 ? neighbor_types[k] : TerrainType::NON_TERRAIN;
       if (std::find(v.begin(), v.end(), target) != v.end())
         score += reward;
       else
@@ -542,10 +872,10 @@ const BetterTerrainPP::Placement* BetterTerrainPP::update_tile_tiles(godot::Vect
     if (score > best_score)
     {
       best_score = score;
-      best = {&p};
+      best = {p};
     }
     else if (score == best_score)
-      best.push_back(&p);
+      best.push_back(p);
   }
 
   if (best.empty())
@@ -554,7 +884,8 @@ const BetterTerrainPP::Placement* BetterTerrainPP::update_tile_tiles(godot::Vect
   return weighted_selection(best, coord, apply_empty_probability);
 }
 
-const BetterTerrainPP::Placement* BetterTerrainPP::update_tile_vertices(godot::Vector2i coord, const std::map<godot::Vector2i, int>& types) const
+template<typename Types>
+const BetterTerrainPP::Placement* BetterTerrainPP::update_tile_vertices(godot::Vector2i coord, const Types& types) const
 {
   int type = map_safe_get(types, coord, -1);
   int best_score = -1000;
@@ -567,12 +898,22 @@ const BetterTerrainPP::Placement* BetterTerrainPP::update_tile_vertices(godot::V
   const int reward = 3;
   const int penalty = -10;
 
-  for (const auto& p : it->second)
+  // Resolve each neighbor and corner once per cell rather than once per
+  // candidate.
+  godot::Vector2i neighbors[16];
+  for (int k : *m_peering_cells)
+    neighbors[k] = neighbor_cell(m_tilemap, types, coord, k);
+
+  int corner_types[16];
+  for (int k = 0; k < 16; ++k)
+    corner_types[k] = probe(neighbors, k, type, types);
+
+  for (const Placement* p : it->second)
   {
     int score = 0;
-    for (const auto& [k, v] : p.peering)
+    for (const auto& [k, v] : p->peering)
     {
-      int target = probe(coord, static_cast<godot::TileSet::CellNeighbor>(k), type, types);
+      int target = k >= 0 && k < 16 ? corner_types[k] : TerrainType::NON_TERRAIN;
       if (std::find(v.begin(), v.end(), target) != v.end())
         score += reward;
       else
@@ -582,10 +923,10 @@ const BetterTerrainPP::Placement* BetterTerrainPP::update_tile_vertices(godot::V
     if (score > best_score)
     {
       best_score = score;
-      best = {&p};
+      best = {p};
     }
     else if (score == best_score)
-      best.push_back(&p);
+      best.push_back(p);
   }
 
   if (best.empty())
@@ -594,24 +935,32 @@ const BetterTerrainPP::Placement* BetterTerrainPP::update_tile_vertices(godot::V
   return weighted_selection(best, coord, false);
 }
 
-int BetterTerrainPP::probe(godot::Vector2i coord, int peering, int type, const std::map<godot::Vector2i, int>& types) const
+template<typename Types>
+int BetterTerrainPP::probe(const godot::Vector2i (&neighbors)[16], int peering, int type, const Types& types) const
 {
-  std::vector<godot::Vector2i> coords = associated_vertex_cells(m_tilemap, coord, static_cast<godot::TileSet::CellNeighbor>(peering));
-  std::vector<int> targets;
-  for (int c = 0; c < static_cast<int>(coords.size()); ++c)
-    targets.push_back(map_safe_get(types, coords[c], -1));
+  const std::vector<int>& vertex_neighbors = m_vertex_neighbors[peering];
+  if (vertex_neighbors.empty())
+    return TerrainType::NON_TERRAIN;
+
+  int targets[3];
+  int count = 0;
+  for (int n : vertex_neighbors)
+    targets[count++] = map_safe_get(types, neighbors[n], -1);
 
   int first = targets[0];
   bool all_equal = true;
-  for (int t = 1; t < static_cast<int>(targets.size()) && all_equal; ++t)
+  for (int t = 1; t < count && all_equal; ++t)
     if (targets[t] != first)
       all_equal = false;
 
   if (all_equal)
     return first;
 
-  targets.erase(std::remove(targets.begin(), targets.end(), type), targets.end());
-  return *std::min_element(targets.begin(), targets.end());
+  int lowest = INT_MAX;
+  for (int t = 0; t < count; ++t)
+    if (targets[t] != type)
+      lowest = std::min(lowest, targets[t]);
+  return lowest;
 }
 
 const BetterTerrainPP::Placement* BetterTerrainPP::weighted_selection(const std::vector<const Placement*>& choices, const godot::Vector2i& coord, bool apply_empty_probability) const
@@ -3,9 +3,12 @@
 #include <godot_cpp/classes/object.hpp>
 #include <godot_cpp/classes/tile_map_layer.hpp>
 #include <godot_cpp/classes/tile_set.hpp>
+#include <godot_cpp/classes/tile_set_atlas_source.hpp>
 #include <godot_cpp/classes/tile_data.hpp>
 #include <godot_cpp/classes/random_number_generator.hpp>
 
+#include "BetterTerrainPPDelta.hpp"
+
 #include <map>
 #include <vector>
 
@@ -22,11 +25,25 @@ class BetterTerrainPP : public godot::Object
     double probability;
   };
 
+  struct SourceCache
+  {
+    uint32_t fingerprint;
+    std::map<int, std::vector<Placement>> placements;
+  };
+
   static Placement empty_placement;
 
   godot::TileMapLayer* m_tilemap;
   godot::Ref<godot::TileSet> m_tileset;
-  std::map<int, std::vector<Placement>> m_cache;
+  // Points into m_sources, or at empty_placement for type -1.
+  std::map<int, std::vector<const Placement*>> m_cache;
+  std::map<int, SourceCache> m_sources;
+  uint32_t m_terrains_hash{0};
+  bool m_rebuild_pending{false};
+
+  // Depend only on the tile shape, so are refreshed with the cache.
+  const std::vector<int>* m_peering_cells{nullptr};
+  std::vector<int> m_vertex_neighbors[16];
   std::vector<int> m_terrain_types;
 
   bool m_fixed_random_seed{false};
@@ -41,21 +58,36 @@ public:
   bool init(godot::TileMapLayer* tilemap, bool fixed_random_seed = false);
 
   int get_cell(godot::Vector2i coord) const;
-  bool set_cell(godot::Vector2i coord, int type);
-  bool set_cells(const godot::Array& coords, int type);
+  bool set_cell(godot::Vector2i coord, int type, const godot::Ref<BetterTerrainPPDelta>& delta = {});
+  bool set_cells(const godot::Array& coords, int type, const godot::Ref<BetterTerrainPPDelta>& delta = {});
+
+  void update_terrain_cells(const godot::Array& cells, bool and_surrounding_cells = true, const godot::Ref<BetterTerrainPPDelta>& delta = {});
+  void update_terrain_cell(godot::Vector2i cell, bool and_surrounding_cells = true, const godot::Ref<BetterTerrainPPDelta>& delta = {});
+  void update_terrain_area(godot::Rect2i area, bool and_surrounding_cells = true, const godot::Ref<BetterTerrainPPDelta>& delta = {});
+
+  bool generate_from_raster(const godot::String& raster_path, int width, const godot::String& output_path, int stripe_rows = 256);
 
-  void update_terrain_cells(const godot::Array& cells, bool and_surrounding_cells = true);
-  void update_terrain_cell(godot::Vector2i cell, bool and_surrounding_cells = true);
-  void update_terrain_area(godot::Rect2i area, bool and_surrounding_cells = true);
+  bool dump_trace(const godot::String& path) const;
 
 private:
+  void on_tileset_changed();
+  void rebuild_if_pending();
+  void rebuild(const godot::Dictionary& meta);
+  uint32_t source_fingerprint(godot::TileSetAtlasSource* source) const;
+  SourceCache compile_source(int source_id, godot::TileSetAtlasSource* source, const std::map<int, std::vector<int>>& types, uint32_t fingerprint) const;
   std::vector<godot::Vector2i> widen(const std::vector<godot::Vector2i>& coords) const;
   std::vector<godot::Vector2i> widen_with_exclusion(const std::vector<godot::Vector2i>& coords, const godot::Rect2i& exclusion) const;
   const std::vector<int>& get_terrain_peering_cells() const;
-  void update_tile_immediate(godot::Vector2i coord, const std::map<godot::Vector2i, int>& types);
-  const Placement* update_tile_tiles(godot::Vector2i coord, const std::map<godot::Vector2i, int>& types, bool apply_empty_probability) const;
-  const Placement* update_tile_vertices(godot::Vector2i coord, const std::map<godot::Vector2i, int>& types) const;
-  int probe(godot::Vector2i coord, int peering, int type, const std::map<godot::Vector2i, int>& types) const;
+  void write_cell(godot::Vector2i coord, int source_id, godot::Vector2i atlas_coord, int alternative, BetterTerrainPPDelta* delta);
+  void update_tiles(const std::vector<godot::Vector2i>& coords, const std::map<godot::Vector2i, int>& types, BetterTerrainPPDelta* delta);
+  template<typename Types>
+  const Placement* select_placement(godot::Vector2i coord, const Types& types) const;
+  template<typename Types>
+  const Placement* update_tile_tiles(godot::Vector2i coord, const Types& types, bool apply_empty_probability) const;
+  template<typename Types>
+  const Placement* update_tile_vertices(godot::Vector2i coord, const Types& types) const;
+  template<typename Types>
+  int probe(const godot::Vector2i (&neighbors)[16], int peering, int type, const Types& types) const;
   const Placement* weighted_selection(const std::vector<const Placement*>& choices, const godot::Vector2i& coord, bool apply_empty_probability) const;
 };
 
@@ -0,0 +1,116 @@
+#include "BetterTerrainPPDelta.hpp"
+#include <godot_cpp/core/class_db.hpp>
+
+#include <algorithm>
+
+namespace
+{
+
+const BetterTerrainPPDelta::Cell empty_cell{-1, godot::Vector2i(-1, -1), -1};
+
+void write_run_cell(godot::TileMapLayer* tilemap, godot::Vector2i coord, const BetterTerrainPPDelta::Cell& cell)
+{
+  if (cell.source_id == -1)
+    tilemap->erase_cell(coord);
+  else
+    tilemap->set_cell(coord, cell.source_id, cell.coord, cell.alternative);
+}
+
+}
+
+void BetterTerrainPPDelta::_bind_methods()
+{
+  godot::ClassDB::bind_method(godot::D_METHOD("apply", "map"), &BetterTerrainPPDelta::apply);
+  godot::ClassDB::bind_method(godot::D_METHOD("revert", "map"), &BetterTerrainPPDelta::revert);
+  godot::ClassDB::bind_method(godot::D_METHOD("clear"), &BetterTerrainPPDelta::clear);
+  godot::ClassDB::bind_method(godot::D_METHOD("get_cell_count"), &BetterTerrainPPDelta::get_cell_count);
+  godot::ClassDB::bind_method(godot::D_METHOD("get_run_count"), &BetterTerrainPPDelta::get_run_count);
+  godot::ClassDB::bind_method(godot::D_METHOD("is_empty"), &BetterTerrainPPDelta::is_empty);
+}
+
+void BetterTerrainPPDelta::record(godot::Vector2i coord, Cell before, Cell after)
+{
+  // Empty cells read back from a TileMapLayer as (-1, (-1, -1), -1), whatever
+  // was passed when they were erased.
+  if (before.source_id == -1)
+    before = empty_cell;
+  if (after.source_id == -1)
+    after = empty_cell;
+
+  if (before == after)
+    return;
+
+  m_pending.push_back(Change{coord, before, after});
+}
+
+void BetterTerrainPPDelta::encode_pending()
+{
+  if (m_pending.empty())
+    return;
+
+  // Stable, so a cell changed more than once keeps its changes in order and
+  // apply and revert still replay them correctly.
+  std::stable_sort(m_pending.begin(), m_pending.end(), [](const Change& a, const Change& b) {
+    return a.coord.y != b.coord.y ? a.coord.y < b.coord.y : a.coord.x < b.coord.x;
+  });
+
+  for (const Change& change : m_pending)
+  {
+    ++m_cell_count;
+    if (!m_runs.empty())
+    {
+      Run& last = m_runs.back();
+      if (last.start.y == change.coord.y && last.start.x + last.length == change.coord.x && last.before == change.before && last.after == change.after)
+      {
+        ++last.length;
+        continue;
+      }
+    }
+
+    m_runs.push_back(Run{change.coord, 1, change.before, change.after});
+  }
+
+  m_pending.clear();
+}
+
+void BetterTerrainPPDelta::apply(godot::TileMapLayer* tilemap) const
+{
+  ERR_FAIL_NULL(tilemap);
+
+  for (const Run& run : m_runs)
+    for (int i = 0; i < run.length; ++i)
+      write_run_cell(tilemap, godot::Vector2i(run.start.x + i, run.start.y), run.after);
+}
+
+void BetterTerrainPPDelta::revert(godot::TileMapLayer* tilemap) const
+{
+  ERR_FAIL_NULL(tilemap);
+
+  // A cell can be recorded more than once, so undo in reverse to end up with
+  // its earliest contents.
+  for (auto it = m_runs.rbegin(); it != m_runs.rend(); ++it)
+    for (int i = 0; i < it->length; ++i)
+      write_run_cell(tilemap, godot::Vector2i(it->start.x + i, it->start.y), it->before);
+}
+
+void BetterTerrainPPDelta::clear()
+{
+  m_pending.clear();
+  m_runs.clear();
+  m_cell_count = 0;
+}
+
+int BetterTerrainPPDelta::get_cell_count() const
+{
+  return m_cell_count;
+}
+
+int BetterTerrainPPDelta::get_run_count() const
+{
+  return static_cast<int>(m_runs.size());
+}
+
+bool BetterTerrainPPDelta::is_empty() const
+{
+  return m_runs.empty() && m_pending.empty();
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <godot_cpp/classes/ref_counted.hpp>
+#include <godot_cpp/classes/tile_map_layer.hpp>
+
+#include <vector>
+
+// Prior and new contents of the cells changed by one or more BetterTerrainPP
+// calls, for undo and redo.
+class BetterTerrainPPDelta : public godot::RefCounted
+{
+  GDCLASS(BetterTerrainPPDelta, RefCounted);
+
+public:
+  struct Cell
+  {
+    int source_id;
+    godot::Vector2i coord;
+    int alternative;
+
+    bool operator==(const Cell& other) const
+    {
+      return source_id == other.source_id && coord == other.coord && alternative == other.alternative;
+    }
+  };
+
+private:
+  // Neighbouring cells along a row that went from the same contents to the
+  // same contents share a run.
+  struct Run
+  {
+    godot::Vector2i start;
+    int length;
+    Cell before;
+    Cell after;
+  };
+
+  struct Change
+  {
+    godot::Vector2i coord;
+    Cell before;
+    Cell after;
+  };
+
+  // Changes arrive in whatever order the caller walks its cells, often down
+  // columns, so they are buffered and sorted into rows by encode_pending.
+  std::vector<Change> m_pending;
+  std::vector<Run> m_runs;
+  int m_cell_count{0};
+
+protected:
+  static void _bind_methods();
+
+public:
+  void record(godot::Vector2i coord, Cell before, Cell after);
+  void encode_pending();
+
+  void apply(godot::TileMapLayer* tilemap) const;
+  void revert(godot::TileMapLayer* tilemap) const;
+  void clear();
+
+  int get_cell_count() const;
+  int get_run_count() const;
+  bool is_empty() const;
+};
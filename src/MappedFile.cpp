@@ -0,0 +1,153 @@
+#include "MappedFile.hpp"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+  close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const godot::String& path)
+{
+  close();
+
+  godot::Char16String wide = path.utf16();
+  HANDLE file = CreateFileW(reinterpret_cast<LPCWSTR>(wide.get_data()), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+  {
+    CloseHandle(file);
+    return false;
+  }
+
+  HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!mapping)
+  {
+    CloseHandle(file);
+    return false;
+  }
+
+  m_file = file;
+  m_mapping = mapping;
+  m_size = static_cast<uint64_t>(size.QuadPart);
+  return true;
+}
+
+void MappedFile::close()
+{
+  unmap();
+  if (m_mapping)
+    CloseHandle(m_mapping);
+  if (m_file)
+    CloseHandle(m_file);
+  m_mapping = nullptr;
+  m_file = nullptr;
+  m_size = 0;
+}
+
+const uint8_t* MappedFile::map(uint64_t offset, uint64_t length)
+{
+  unmap();
+  if (!m_mapping || length == 0 || offset + length > m_size)
+    return nullptr;
+
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  const uint64_t skew = offset % info.dwAllocationGranularity;
+  const uint64_t start = offset - skew;
+
+  void* view = MapViewOfFile(m_mapping, FILE_MAP_READ, static_cast<DWORD>(start >> 32), static_cast<DWORD>(start & 0xffffffff), static_cast<SIZE_T>(length + skew));
+  if (!view)
+    return nullptr;
+
+  m_view = view;
+  m_view_length = length + skew;
+  return static_cast<const uint8_t*>(view) + skew;
+}
+
+void MappedFile::unmap()
+{
+  if (m_view)
+    UnmapViewOfFile(m_view);
+  m_view = nullptr;
+  m_view_length = 0;
+}
+
+#else
+
+bool MappedFile::open(const godot::String& path)
+{
+  close();
+
+  int fd = ::open(path.utf8().get_data(), O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0)
+  {
+    ::close(fd);
+    return false;
+  }
+
+  m_fd = fd;
+  m_size = static_cast<uint64_t>(st.st_size);
+  return true;
+}
+
+void MappedFile::close()
+{
+  unmap();
+  if (m_fd >= 0)
+    ::close(m_fd);
+  m_fd = -1;
+  m_size = 0;
+}
+
+const uint8_t* MappedFile::map(uint64_t offset, uint64_t length)
+{
+  unmap();
+  if (m_fd < 0 || length == 0 || offset + length > m_size)
+    return nullptr;
+
+  const uint64_t page = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+  const uint64_t skew = offset % page;
+  const uint64_t start = offset - skew;
+
+  void* view = mmap(nullptr, length + skew, PROT_READ, MAP_PRIVATE, m_fd, static_cast<off_t>(start));
+  if (view == MAP_FAILED)
+    return nullptr;
+
+  madvise(view, length + skew, MADV_SEQUENTIAL);
+  m_view = view;
+  m_view_length = length + skew;
+  return static_cast<const uint8_t*>(view) + skew;
+}
+
+void MappedFile::unmap()
+{
+  if (m_view)
+    munmap(m_view, m_view_length);
+  m_view = nullptr;
+  m_view_length = 0;
+}
+
+#endif
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <godot_cpp/variant/string.hpp>
+
+#include <cstdint>
+
+// Read-only memory mapping of a file, one view at a time. Views are mapped
+// on demand so large files can be walked without keeping them resident.
+class MappedFile
+{
+public:
+  MappedFile() = default;
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  ~MappedFile();
+
+  bool open(const godot::String& path);
+  void close();
+
+  uint64_t size() const { return m_size; }
+
+  // Maps [offset, offset + length) and returns a pointer to offset, replacing
+  // any previous view. Returns nullptr on failure.
+  const uint8_t* map(uint64_t offset, uint64_t length);
+  void unmap();
+
+private:
+#ifdef _WIN32
+  void* m_file{nullptr};
+  void* m_mapping{nullptr};
+#else
+  int m_fd{-1};
+#endif
+  uint64_t m_size{0};
+  void* m_view{nullptr};
+  uint64_t m_view_length{0};
+};
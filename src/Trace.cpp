@@ -0,0 +1,78 @@
+#include "Trace.hpp"
+
+#ifdef BETTER_TERRAIN_TRACE
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+
+namespace
+{
+
+struct Event
+{
+  const char* name;
+  uint64_t start_us;
+  uint64_t duration_us;
+  uint32_t thread;
+};
+
+const size_t ring_size = 1 << 16;
+
+std::mutex ring_mutex;
+Event ring[ring_size];
+uint64_t ring_next = 0;
+
+const auto epoch = std::chrono::steady_clock::now();
+
+uint32_t thread_index()
+{
+  static std::atomic<uint32_t> next{1};
+  thread_local uint32_t index = next.fetch_add(1);
+  return index;
+}
+
+}
+
+namespace trace
+{
+
+uint64_t now_us()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+void record(const char* name, uint64_t start_us, uint64_t end_us)
+{
+  const uint32_t thread = thread_index();
+  std::lock_guard<std::mutex> lock(ring_mutex);
+  ring[ring_next % ring_size] = Event{name, start_us, end_us - start_us, thread};
+  ++ring_next;
+}
+
+godot::String chrome_json()
+{
+  std::string json = "{\"traceEvents\":[";
+  {
+    std::lock_guard<std::mutex> lock(ring_mutex);
+    const uint64_t first = ring_next > ring_size ? ring_next - ring_size : 0;
+    for (uint64_t i = first; i < ring_next; ++i)
+    {
+      const Event& e = ring[i % ring_size];
+      if (i != first)
+        json += ',';
+      json += "{\"name\":\"";
+      json += e.name;
+      json += "\",\"ph\":\"X\",\"pid\":1,\"tid\":" + std::to_string(e.thread);
+      json += ",\"ts\":" + std::to_string(e.start_us);
+      json += ",\"dur\":" + std::to_string(e.duration_us) + "}";
+    }
+  }
+  json += "]}";
+  return godot::String::utf8(json.c_str(), static_cast<int64_t>(json.size()));
+}
+
+}
+
+#endif
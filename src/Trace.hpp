@@ -0,0 +1,43 @@
+#pragma once
+
+// Scoped trace zones, compiled in only when building with trace=yes. Completed
+// zones go into a fixed size ring buffer, so the most recent ones are kept.
+
+#ifdef BETTER_TERRAIN_TRACE
+
+#include <godot_cpp/variant/string.hpp>
+
+#include <cstdint>
+
+namespace trace
+{
+
+uint64_t now_us();
+void record(const char* name, uint64_t start_us, uint64_t end_us);
+godot::String chrome_json();
+
+class Zone
+{
+public:
+  explicit Zone(const char* name) : m_name(name), m_start(now_us()) {}
+  ~Zone() { record(m_name, m_start, now_us()); }
+
+  Zone(const Zone&) = delete;
+  Zone& operator=(const Zone&) = delete;
+
+private:
+  const char* m_name;
+  uint64_t m_start;
+};
+
+}
+
+#define BT_TRACE_CONCAT_INNER(a, b) a##b
+#define BT_TRACE_CONCAT(a, b) BT_TRACE_CONCAT_INNER(a, b)
+#define BT_TRACE_ZONE(name) trace::Zone BT_TRACE_CONCAT(bt_trace_zone_, __LINE__)(name)
+
+#else
+
+#define BT_TRACE_ZONE(name) ((void)0)
+
+#endif
@@ -5,6 +5,7 @@
 #include <godot_cpp/godot.hpp>
 
 #include "BetterTerrainPP.hpp"
+#include "BetterTerrainPPDelta.hpp"
 
 void initialize_better_terrain_pp(godot::ModuleInitializationLevel level)
 {
@@ -12,6 +13,7 @@ void initialize_better_terrain_pp(godot::ModuleInitializationLevel level)
     return;
   
   godot::ClassDB::register_class<BetterTerrainPP>();
+  godot::ClassDB::register_class<BetterTerrainPPDelta>();
 }
 
 void uninitialize_better_terrain_pp(godot::ModuleInitializationLevel level)